@@ -0,0 +1,221 @@
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#include "ocltiled2d.hpp"
+
+
+
+/**
+ * Host reference of the 'transpose' kernel.
+ */
+void reference_transpose (const real *input,
+                          real *output,
+                          const int width,
+                          const int height)
+{
+    int x, y;
+    for (y = 0; y < height; y ++)
+        for (x = 0; x < width; x ++)
+            output[y + x*height] = input[x + y*width];
+}
+
+/**
+ * Host reference of the 'gemm' kernel.
+ */
+void reference_gemm (const real *a,
+                     const real *b,
+                     real *c,
+                     const int m,
+                     const int n,
+                     const int k)
+{
+    int row, col, i;
+    for (row = 0; row < m; row ++)
+    {
+        for (col = 0; col < n; col ++)
+        {
+            real acc = 0;
+            for (i = 0; i < k; i ++)
+                acc += a[i + row*k] * b[col + i*n];
+            c[col + row*n] = acc;
+        }
+    }
+}
+
+/**
+ * Host reference of the 'stencil' kernel.
+ */
+void reference_stencil (const real *input,
+                        const real *weights,
+                        real *output,
+                        const int width,
+                        const int height,
+                        const int radius)
+{
+    int x, y, i, j, ix, iy;
+    int side = 2*radius + 1;
+    for (y = 0; y < height; y ++)
+    {
+        for (x = 0; x < width; x ++)
+        {
+            real acc = 0;
+            for (j = 0; j < side; j ++)
+            {
+                for (i = 0; i < side; i ++)
+                {
+                    // clamp to the nearest border
+                    ix = std::min (std::max (x + i - radius, 0), width - 1);
+                    iy = std::min (std::max (y + j - radius, 0), height - 1);
+                    acc += weights[i + j*side] * input[ix + iy*width];
+                }
+            }
+            output[x + y*width] = acc;
+        }
+    }
+}
+
+/**
+ * Counts the elements of 'results' differing from 'expected'
+ * by more than 'tolerance'.
+ */
+unsigned int count_errors (const real *results,
+                           const real *expected,
+                           const unsigned int nelem,
+                           const real tolerance)
+{
+    unsigned int i, errors = 0;
+    for (i = 0; i < nelem; i ++)
+    {
+        if (std::fabs (results[i] - expected[i]) > tolerance)
+            ++errors;
+    }
+    return errors;
+}
+
+/**
+ * Prints the average time per launch and the effective bandwidth.
+ */
+void report (const char *name,
+             const double seconds,
+             const unsigned int reps,
+             const double bytes,
+             const unsigned int errors)
+{
+    std::cout << name << "\t"
+              << (seconds / reps) * 1e3 << " ms\t"
+              << (bytes * reps / seconds) * 1e-9 << " GB/s\t"
+              << errors << " errors" << std::endl;
+}
+
+
+
+/**
+ * Benchmark entry point
+ */
+int main (int argc, char** argv)
+{
+    unsigned int i, r, errors, failed = 0;
+    // Matrix sizes are deliberately not a multiple of the tile size
+    const int wh = 1000;
+    const int ht = 1000;
+    const int radius = 2;
+    const unsigned int nelem = wh*ht;
+    const unsigned int nweights = (2*radius + 1)*(2*radius + 1);
+    const unsigned int reps = 10;
+    size_t memSize = sizeof(real)*nelem;
+
+    real *a = new real [nelem];
+    real *b = new real [nelem];
+    real *weights = new real [nweights];
+    real *results = new real [nelem];
+    real *expected = new real [nelem];
+
+    for (i = 0; i < nelem; i++)
+    {
+        a[i] = rand ( ) / (real)RAND_MAX;
+        b[i] = rand ( ) / (real)RAND_MAX;
+    }
+    for (i = 0; i < nweights; i++)
+    {
+        weights[i] = 1.0 / nweights;
+    }
+
+    try
+    {
+        OCLKernel kernel ("tiled2d.cl");
+        kernel.init (false);
+
+        OCLTiled2D tiled (kernel, radius);
+        tiled.build ( );
+        std::cout << ":: Tile size is " << tiled.get_tile_dim ( )
+                  << " x " << tiled.get_tile_dim ( ) << std::endl;
+
+        cl::Context ctx = kernel.get_context ( );
+        cl::Buffer dev_a (ctx, CL_MEM_READ_ONLY, memSize);
+        cl::Buffer dev_b (ctx, CL_MEM_READ_ONLY, memSize);
+        cl::Buffer dev_w (ctx, CL_MEM_READ_ONLY, sizeof(real)*nweights);
+        cl::Buffer dev_c (ctx, CL_MEM_WRITE_ONLY, memSize);
+
+        kernel.write_buffer (dev_a, a, memSize);
+        kernel.write_buffer (dev_b, b, memSize);
+        kernel.write_buffer (dev_w, weights, sizeof(real)*nweights);
+
+        std::chrono::steady_clock::time_point start;
+        std::chrono::duration<double> elapsed;
+
+        // transpose: one read and one write per element
+        tiled.prepare_transpose (dev_a, dev_c, wh, ht);
+        start = std::chrono::steady_clock::now ( );
+        for (r = 0; r < reps; r ++)
+            tiled.run ( );
+        elapsed = std::chrono::steady_clock::now ( ) - start;
+        kernel.read_buffer (dev_c, results, memSize);
+        reference_transpose (a, expected, wh, ht);
+        errors = count_errors (results, expected, nelem, 0);
+        report ("transpose", elapsed.count ( ), reps, 2.0*memSize, errors);
+        failed += errors;
+
+        // stencil: one read and one write per element, halo aside
+        tiled.prepare_stencil (dev_a, dev_w, dev_c, wh, ht);
+        start = std::chrono::steady_clock::now ( );
+        for (r = 0; r < reps; r ++)
+            tiled.run ( );
+        elapsed = std::chrono::steady_clock::now ( ) - start;
+        kernel.read_buffer (dev_c, results, memSize);
+        reference_stencil (a, weights, expected, wh, ht, radius);
+        errors = count_errors (results, expected, nelem, 1e-9);
+        report ("stencil", elapsed.count ( ), reps, 2.0*memSize, errors);
+        failed += errors;
+
+        // gemm: square matrices, the whole of A and B is read at least once
+        tiled.prepare_gemm (dev_a, dev_b, dev_c, ht, wh, wh);
+        start = std::chrono::steady_clock::now ( );
+        for (r = 0; r < reps; r ++)
+            tiled.run ( );
+        elapsed = std::chrono::steady_clock::now ( ) - start;
+        kernel.read_buffer (dev_c, results, memSize);
+        reference_gemm (a, b, expected, ht, wh, wh);
+        errors = count_errors (results, expected, nelem, 1e-9*wh);
+        report ("gemm", elapsed.count ( ), reps, 3.0*memSize, errors);
+        failed += errors;
+    }
+    catch (cl::Error &error)
+    {
+        std::cerr << "::: ERROR "
+                  << error.what ( )
+                  << "(" << error.err ( ) << ")"
+                  << std::endl;
+        failed ++;
+    }
+
+    // Free allocated resources
+    delete [] expected;
+    delete [] results;
+    delete [] weights;
+    delete [] b;
+    delete [] a;
+
+    // non-zero if any kernel disagrees with its host reference
+    return (failed > 0) ? 1 : 0;
+}
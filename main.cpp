@@ -1,4 +1,9 @@
+#include <thread>
+
 #include "oclkernel.hpp"
+#include "oclbatch.hpp"
+#include "oclqueueset.hpp"
+#include "oclprogramcache.hpp"
 
 
 /**
@@ -37,12 +42,18 @@ int main (int argc, char** argv)
         // Initialize the OpenCL backend
         kernel.init ( );
 
-        // Get a pointer to the initialized OpenCL context
-        cl::Context ctx = kernel.get_context ( );
+        // Declare memory on the device, used as kernel parameters;
+        // it is accounted for in the runtime metrics until released
+        cl::Buffer input = kernel.create_buffer (CL_MEM_READ_ONLY, memSize);
+        cl::Buffer output = kernel.create_buffer (CL_MEM_WRITE_ONLY, memSize);
 
-        // Declare memory on the device, used as kernel parameters
-        cl::Buffer input (ctx, CL_MEM_READ_ONLY, memSize);
-        cl::Buffer output (ctx, CL_MEM_WRITE_ONLY, memSize);
+        //
+        // Buffers may also be created directly on the OpenCL context,
+        // in which case they are not accounted for, e.g.
+        //
+        //cl::Context ctx = kernel.get_context ( );
+        //cl::Buffer input (ctx, CL_MEM_READ_ONLY, memSize);
+        //
  
         // Send data to the device
         kernel.write_buffer (input, data, memSize);
@@ -117,7 +128,212 @@ int main (int argc, char** argv)
     std::cout << "Computed " << correct << "/" << nelem;
     std::cout << " correct values." << std::endl;
 
+    //
+    // Many small problems of the same shape are packed
+    // together and solved in a single kernel launch.
+    //
+    const unsigned int nprob = 64;
+    real *batch_data = new real [nprob*nelem];
+    real *batch_results = new real [nprob*nelem];
+
+    for (i = 0; i < nprob*nelem; i++)
+    {
+        batch_data[i] = rand ( ) / (real)RAND_MAX;
+    }
+
+    try
+    {
+        OCLKernel kernel ("other_square.cl");
+        kernel.init ( );
+        kernel.build ("-I.");
+        kernel.activate_kernel ("batched_square");
+
+        // the range of one problem; the batch index is added as 3rd dimension
+        size_t problem_sizes [] = {wh, ht};
+        size_t local_sizes [] = {wh, ht};
+        OCLBatch batch (kernel,
+                        problem_sizes,
+                        local_sizes,
+                        memSize,
+                        memSize,
+                        nprob);
+
+        for (i = 0; i < nprob; i++)
+        {
+            batch.add (&batch_data[i*nelem], &batch_results[i*nelem]);
+        }
+        batch.run ( );
+
+        //
+        // Concurrent callers may also submit their problems through
+        // a queue, which gathers them up to a size or time limit:
+        //
+        //OCLBatchQueue queue (batch, nprob, 100);
+        //queue.submit (&batch_data[0], &batch_results[0]);
+        //
+    }
+    catch (cl::Error &error)
+    {
+        std::cerr << "::: ERROR "
+                  << error.what ( )
+                  << "(" << error.err ( ) << ")"
+                  << std::endl;
+    }
+
+    std::cout << "Testing batched results ..." << std::endl;
+    correct = 0;
+    for (i = 0; i < nprob*nelem; i++)
+    {
+        if (batch_results[i] == batch_data[i]*batch_data[i])
+            ++correct;
+    }
+    std::cout << "Computed " << correct << "/" << nprob*nelem;
+    std::cout << " correct values." << std::endl;
+
+    //
+    // Independent work may overlap on several queues of the same
+    // device; each stream keeps its own commands in order, while
+    // different streams work on different buffers.
+    //
+    const unsigned int nstreams = 2;
+    real *stream_data = new real [nstreams*nelem];
+    real *stream_results = new real [nstreams*nelem];
+
+    for (i = 0; i < nstreams*nelem; i++)
+    {
+        stream_data[i] = rand ( ) / (real)RAND_MAX;
+        stream_results[i] = 0;
+    }
+
+    try
+    {
+        OCLKernel kernel ("other_square.cl");
+        kernel.init ( );
+        kernel.build ("-I.");
+        kernel.activate_kernel ("square");
+
+        size_t global_sizes [] = {wh, ht};
+        size_t local_sizes [] = {wh, ht};
+        kernel.set_2D_range (global_sizes, local_sizes);
+
+        OCLQueueSet queues (kernel, 2, 1);
+        OCLStream first (queues), second (queues);
+        cl::Buffer first_input = kernel.create_buffer (CL_MEM_READ_ONLY, memSize);
+        cl::Buffer first_output = kernel.create_buffer (CL_MEM_WRITE_ONLY, memSize);
+        cl::Buffer second_input = kernel.create_buffer (CL_MEM_READ_ONLY, memSize);
+        cl::Buffer second_output = kernel.create_buffer (CL_MEM_WRITE_ONLY, memSize);
+
+        first.write_buffer (first_input, &stream_data[0], memSize);
+        second.write_buffer (second_input, &stream_data[nelem], memSize);
+
+        // kernel parameters are captured when the launch is enqueued
+        kernel.set_arg (0, first_input);
+        kernel.set_arg (1, first_output);
+        first.run (kernel);
+        kernel.set_arg (0, second_input);
+        kernel.set_arg (1, second_output);
+        second.run (kernel);
+
+        first.read_buffer (first_output, &stream_results[0], memSize);
+        second.read_buffer (second_output, &stream_results[nelem], memSize);
+        queues.finish ( );
+    }
+    catch (cl::Error &error)
+    {
+        std::cerr << "::: ERROR "
+                  << error.what ( )
+                  << "(" << error.err ( ) << ")"
+                  << std::endl;
+    }
+
+    std::cout << "Testing stream results ..." << std::endl;
+    correct = 0;
+    for (i = 0; i < nstreams*nelem; i++)
+    {
+        if (stream_results[i] == stream_data[i]*stream_data[i])
+            ++correct;
+    }
+    std::cout << "Computed " << correct << "/" << nstreams*nelem;
+    std::cout << " correct values." << std::endl;
+
+    //
+    // Programs specialised on compile-time constants may be kept
+    // in a cache; the generic one is used while they compile.
+    //
+    const real constant = 3;
+    bool generic_first = false;
+    bool specialised = false;
+    real *cache_results = new real [nelem];
+
+    for (i = 0; i < nelem; i++)
+    {
+        cache_results[i] = 0;
+    }
+
+    try
+    {
+        OCLKernel kernel ("other_square.cl");
+        kernel.init ( );
+
+        OCLProgramCache cache (kernel, "-I.");
+        OCLProgramCache::Defines defines;
+        defines["_MY_CONSTANT_"] = "3";
+
+        cl::Buffer input = kernel.create_buffer (CL_MEM_READ_ONLY, memSize);
+        cl::Buffer output = kernel.create_buffer (CL_MEM_WRITE_ONLY, memSize);
+        kernel.write_buffer (input, data, memSize);
+
+        // the first request starts compiling the specialisation ...
+        generic_first = !cache.activate_kernel ("scaled_square", defines);
+
+        // ... which is returned once it is ready
+        for (i = 0; (i < 1000) && (!specialised); i++)
+        {
+            specialised = cache.activate_kernel ("scaled_square", defines);
+            if (!specialised)
+                std::this_thread::sleep_for (std::chrono::milliseconds (10));
+        }
+
+        // a different kernel object, so its parameters are set again
+        size_t global_sizes [] = {wh, ht};
+        size_t local_sizes [] = {wh, ht};
+        kernel.set_2D_range (global_sizes, local_sizes);
+        kernel.set_arg (0, input);
+        kernel.set_arg (1, output);
+        kernel.run_and_wait ( );
+        kernel.read_buffer (output, cache_results, memSize);
+    }
+    catch (cl::Error &error)
+    {
+        std::cerr << "::: ERROR "
+                  << error.what ( )
+                  << "(" << error.err ( ) << ")"
+                  << std::endl;
+    }
+
+    std::cout << "Testing specialised results ..." << std::endl;
+    if (!generic_first)
+        std::cout << "The generic program was not returned first" << std::endl;
+    if (!specialised)
+        std::cout << "The specialised program was never returned" << std::endl;
+    correct = 0;
+    for (i = 0; i < nelem; i++)
+    {
+        if (cache_results[i] == constant*data[i]*data[i])
+            ++correct;
+    }
+    std::cout << "Computed " << correct << "/" << nelem;
+    std::cout << " correct values." << std::endl;
+
+    // Runtime metrics, also available as JSON with 'to_json( )'
+    std::cout << OCLMetrics::instance ( ).to_prometheus ( );
+
     // Free allocated resources
+    delete [] cache_results;
+    delete [] stream_results;
+    delete [] stream_data;
+    delete [] batch_results;
+    delete [] batch_data;
     delete [] results;
     delete [] data;
 
@@ -0,0 +1,299 @@
+#ifndef _OCLBATCH_HPP_
+#define _OCLBATCH_HPP_
+
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "oclkernel.hpp"
+
+
+
+/**
+ * Packs many small, same-shaped problems into contiguous device buffers
+ * and solves them with a single kernel launch.
+ * The activated kernel receives the packed input and output buffers as
+ * arguments 0 and 1, and the index of the problem it is working on is
+ * given by 'get_global_id(2)', e.g. 'batched_square' in 'square.cl'.
+ * Any other kernel argument should be set before calling 'run( )'.-
+ */
+class OCLBatch
+{
+    public:
+        /**
+         * Constructor.
+         * Every problem has a 2-dimensional execution range of
+         * 'problem_sizes', with 'local_sizes' threads per work group,
+         * reading 'input_size' bytes and writing 'output_size' bytes.
+         * At most 'capacity' problems are packed in one launch.
+         */
+        OCLBatch (OCLKernel &kernel,
+                  const size_t problem_sizes [],
+                  const size_t local_sizes [],
+                  const size_t input_size,
+                  const size_t output_size,
+                  const unsigned int capacity) : kernel(kernel),
+                                                 input_size(input_size),
+                                                 output_size(output_size),
+                                                 capacity(capacity),
+                                                 count(0)
+        {
+            this->problem_sizes[0] = problem_sizes[0];
+            this->problem_sizes[1] = problem_sizes[1];
+            this->local_sizes[0] = local_sizes[0];
+            this->local_sizes[1] = local_sizes[1];
+
+            // host staging areas, holding the packed problems
+            this->host_input.resize (capacity * input_size);
+            this->host_output.resize (capacity * output_size);
+            this->destinations.resize (capacity);
+
+            // device buffers, allocated once for the whole batch
+            this->device_input = kernel.create_buffer (CL_MEM_READ_ONLY,
+                                                       capacity * input_size);
+            this->device_output = kernel.create_buffer (CL_MEM_WRITE_ONLY,
+                                                        capacity * output_size);
+        }
+
+        /**
+         * Destructor
+         */
+        virtual ~OCLBatch ( )
+        {
+        }
+
+        /**
+         * Copies the problem data pointed by 'input' into the next free
+         * slot of the batch. Its results will be written to the address
+         * pointed by 'output' after calling 'run( )'.
+         * Returns false if the batch is already full.
+         */
+        bool add (const void *input, void *output)
+        {
+            if (this->is_full ( ))
+            {
+                std::cerr << "::: ERROR batch is full ("
+                          << this->capacity << " problems)" << std::endl;
+                return false;
+            }
+            std::memcpy (&this->host_input[this->count * this->input_size],
+                         input,
+                         this->input_size);
+            this->destinations[this->count] = output;
+            this->count ++;
+
+            return true;
+        }
+
+        /**
+         * Solves all the problems added so far in a single launch,
+         * scattering the results back to their destinations.
+         * Throws cl::Error if the launch fails, in which case no
+         * destination is written. The batch is emptied in any case.
+         */
+        void run ( )
+        {
+            unsigned int i;
+
+            if (this->count == 0)
+                return;
+
+            try
+            {
+                // one transfer for all the problems
+                this->kernel.write_buffer (this->device_input,
+                                           &this->host_input[0],
+                                           this->count * this->input_size);
+
+                // the batch index is the third dimension of the range
+                size_t global_sizes [] = {this->problem_sizes[0],
+                                          this->problem_sizes[1],
+                                          this->count};
+                size_t local_sizes [] = {this->local_sizes[0],
+                                         this->local_sizes[1],
+                                         1};
+                if (!this->kernel.set_3D_range (global_sizes, local_sizes))
+                    throw cl::Error (CL_INVALID_WORK_GROUP_SIZE,
+                                     "OCLBatch: invalid execution range");
+                this->kernel.set_arg (0, this->device_input);
+                this->kernel.set_arg (1, this->device_output);
+                if (!this->kernel.run_and_wait ( ))
+                    throw cl::Error (CL_INVALID_OPERATION,
+                                     "OCLBatch: kernel execution failed");
+
+                // one transfer back, then scatter
+                this->kernel.read_buffer (this->device_output,
+                                          &this->host_output[0],
+                                          this->count * this->output_size);
+            }
+            catch (cl::Error &error)
+            {
+                // never scatter to these destinations later on
+                this->clear ( );
+                throw;
+            }
+            for (i = 0; i < this->count; i ++)
+            {
+                std::memcpy (this->destinations[i],
+                             &this->host_output[i * this->output_size],
+                             this->output_size);
+            }
+            this->clear ( );
+        }
+
+        /**
+         * Drops all the problems added so far.
+         */
+        void clear ( )
+        {
+            this->count = 0;
+        }
+
+        bool is_full ( )
+        {
+            return (this->count >= this->capacity);
+        }
+
+        unsigned int get_count ( )
+        {
+            return this->count;
+        }
+
+        unsigned int get_capacity ( )
+        {
+            return this->capacity;
+        }
+
+
+        private:
+            OCLKernel &kernel;
+            size_t problem_sizes [2];
+            size_t local_sizes [2];
+            size_t input_size;
+            size_t output_size;
+            unsigned int capacity;
+            unsigned int count;
+            std::vector<char> host_input;
+            std::vector<char> host_output;
+            std::vector<void*> destinations;
+            cl::Buffer device_input;
+            cl::Buffer device_output;
+
+            OCLBatch (const OCLBatch&);
+            OCLBatch& operator= (const OCLBatch&);
+};
+
+
+
+/**
+ * Gathers problems submitted by concurrent callers into one OCLBatch.
+ * The first caller of a batch waits until 'max_jobs' problems have been
+ * submitted or 'max_wait_usec' microseconds have passed, and then
+ * launches the whole batch on behalf of everyone else.-
+ */
+class OCLBatchQueue
+{
+    public:
+        /**
+         * Constructor
+         */
+        OCLBatchQueue (OCLBatch &batch,
+                       const unsigned int max_jobs,
+                       const unsigned int max_wait_usec) : batch(batch),
+                                                           max_jobs(max_jobs),
+                                                           max_wait_usec(max_wait_usec),
+                                                           pending(0),
+                                                           solved(std::make_shared<bool> (false)),
+                                                           flushing(false)
+        {
+            // never gather more problems than the batch can hold
+            if ((this->max_jobs == 0) || (this->max_jobs > batch.get_capacity ( )))
+                this->max_jobs = batch.get_capacity ( );
+        }
+
+        /**
+         * Submits one problem, blocking until its results have been
+         * written to the address pointed by 'output'.
+         * Returns false if the problem could not be solved, in which
+         * case 'output' is left untouched.
+         */
+        bool submit (const void *input, void *output)
+        {
+            std::unique_lock<std::mutex> lock (this->mutex);
+
+            // the staging area is in use while a batch is running
+            while (this->flushing || (this->pending >= this->max_jobs))
+                this->cond.wait (lock);
+
+            if (!this->batch.add (input, output))
+                return false;
+
+            // shared by every caller of this batch
+            std::shared_ptr<bool> solved = this->solved;
+            this->pending ++;
+
+            if (this->pending == 1)
+            {
+                // first caller: wait for others, then launch the batch
+                std::chrono::steady_clock::time_point deadline;
+                deadline = std::chrono::steady_clock::now ( ) +
+                           std::chrono::microseconds (this->max_wait_usec);
+                while (this->pending < this->max_jobs)
+                {
+                    if (this->cond.wait_until (lock, deadline) == std::cv_status::timeout)
+                        break;
+                }
+                this->flushing = true;
+                lock.unlock ( );
+
+                bool success = true;
+                try
+                {
+                    this->batch.run ( );
+                }
+                catch (cl::Error &error)
+                {
+                    success = false;
+                    std::cerr << "::: ERROR batched execution failed!" << std::endl;
+                    std::cerr << "::: ERROR " << error.what ( )
+                              << "(" << error.err ( ) << ")" << std::endl;
+                }
+
+                lock.lock ( );
+                *solved = success;
+                this->solved = std::make_shared<bool> (false);
+                this->flushing = false;
+                this->pending = 0;
+                this->cond.notify_all ( );
+            }
+            else
+            {
+                // wake the first caller up if the batch is complete
+                if (this->pending >= this->max_jobs)
+                    this->cond.notify_all ( );
+                // a new outcome is set up once this batch is done
+                while (solved == this->solved)
+                    this->cond.wait (lock);
+            }
+            return *solved;
+        }
+
+
+        private:
+            OCLBatch &batch;
+            unsigned int max_jobs;
+            unsigned int max_wait_usec;
+            unsigned int pending;
+            std::shared_ptr<bool> solved;
+            bool flushing;
+            std::mutex mutex;
+            std::condition_variable cond;
+
+            OCLBatchQueue (const OCLBatchQueue&);
+            OCLBatchQueue& operator= (const OCLBatchQueue&);
+};
+
+#endif
@@ -15,9 +15,11 @@
 #include <fstream>
 #include <string>
 #include <assert.h>
+#include <chrono>
 #include <CL/cl.hpp>
 
 #include "precision.h"
+#include "oclmetrics.hpp"
 
 
 
@@ -32,6 +34,7 @@ class OCLKernel
          */
         OCLKernel (const char* filename) : context_ptr(0), queue_ptr(0),
                                            program_ptr(0), kernel_ptr(0),
+                                           launch_counter(0),
                                            m_size(0), m_source(0), 
                                            verbose(true), functor_active(false)
         {
@@ -123,16 +126,21 @@ class OCLKernel
                         for (itd = this->devices.begin ( ); itd < this->devices.end ( ); itd ++)
                         {
                             std::string buff2;
+                            size_t wgroup_size;
+                            cl_ulong mem_size;
                             itd->getInfo (CL_DEVICE_NAME, &buff2);
                             std::cout << "\t|| Device " << devn << " || " << buff2 << std::endl;
                             itd->getInfo (CL_DEVICE_VENDOR, &buff2);
                             std::cout << "\t|| Vendor " << devn << " || " << buff2 << std::endl;
-                            itd->getInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE, &(this->max_wgroup_size));
+                            itd->getInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE, &wgroup_size);
                             std::cout << "\t|| Maximum threads per block || "
-                                      << this->max_wgroup_size << std::endl;
-                            itd->getInfo (CL_DEVICE_LOCAL_MEM_SIZE, &(this->local_mem_size));
+                                      << wgroup_size << std::endl;
+                            itd->getInfo (CL_DEVICE_LOCAL_MEM_SIZE, &mem_size);
                             std::cout << "\t|| Local memory size || "
-                                      << this->local_mem_size << std::endl;
+                                      << mem_size << std::endl;
+                            itd->getInfo (CL_DEVICE_GLOBAL_MEM_SIZE, &mem_size);
+                            std::cout << "\t|| Global memory size || "
+                                      << mem_size << std::endl;
                             devn ++;
                         }
                     }
@@ -150,6 +158,13 @@ class OCLKernel
                                                         this->devices[0]);
                 this->queue = *(this->queue_ptr);
 
+                // hardware limits of the device the queue runs on,
+                // needed even in quiet mode
+                this->devices[0].getInfo (CL_DEVICE_MAX_WORK_GROUP_SIZE, &(this->max_wgroup_size));
+                this->devices[0].getInfo (CL_DEVICE_LOCAL_MEM_SIZE, &(this->local_mem_size));
+                this->devices[0].getInfo (CL_DEVICE_GLOBAL_MEM_SIZE, &(this->global_mem_size));
+                OCLMetrics::instance ( ).set_global_mem_size (this->global_mem_size);
+
                 if (this->verbose)
                 {
                     std::string buff;
@@ -161,6 +176,7 @@ class OCLKernel
             } 
             catch (cl::Error &error)
             {
+                OCLMetrics::instance ( ).error (error.err ( ));
                 std::cerr << "::: ERROR: initialization failed!" << std::endl;
                 std::cerr << "::: ERROR: " << error.what ( ) 
                           << "(" << error.err ( ) << ")"
@@ -176,13 +192,27 @@ class OCLKernel
                           void *host_data, 
                           const size_t data_size)
         {
-            cl_int error = this->queue.enqueueReadBuffer (device_data,
-                                                          CL_TRUE, 
-                                                          0, 
-                                                          data_size, 
-                                                          host_data);
-            if (error != CL_SUCCESS)
+            cl_int error;
+            try
+            {
+                error = this->queue.enqueueReadBuffer (device_data,
+                                                       CL_TRUE, 
+                                                       0, 
+                                                       data_size, 
+                                                       host_data);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
+            if (error == CL_SUCCESS)
             {
+                OCLMetrics::instance ( ).device_to_host (data_size);
+            }
+            else
+            {
+                OCLMetrics::instance ( ).error (error);
                 std::cerr << "::: ERROR reading data from device" << std::endl;
             }
         }
@@ -195,17 +225,62 @@ class OCLKernel
                            const void *host_data, 
                            const size_t data_size)
         {
-            cl_int error = this->queue.enqueueWriteBuffer (device_data,
-                                                           CL_TRUE, 
-                                                           0, 
-                                                           data_size, 
-                                                           host_data);
-            if (error != CL_SUCCESS)
+            cl_int error;
+            try
             {
+                error = this->queue.enqueueWriteBuffer (device_data,
+                                                        CL_TRUE, 
+                                                        0, 
+                                                        data_size, 
+                                                        host_data);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
+            if (error == CL_SUCCESS)
+            {
+                OCLMetrics::instance ( ).host_to_device (data_size);
+            }
+            else
+            {
+                OCLMetrics::instance ( ).error (error);
                 std::cerr << "::: ERROR writing data to device" << std::endl;
             }
         }
 
+        /**
+         * Allocates 'data_size' bytes of device memory, which are
+         * accounted for in OCLMetrics until the buffer is released.
+         * Buffers are not accounted for on OpenCL 1.0 runtimes, which
+         * cannot tell when they are released.
+         */
+        cl::Buffer create_buffer (const cl_mem_flags flags,
+                                  const size_t data_size)
+        {
+            cl::Buffer buffer;
+            try
+            {
+                buffer = cl::Buffer (this->context, flags, data_size);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
+
+            cl_int error = clSetMemObjectDestructorCallback (buffer ( ),
+                                                             &OCLKernel::release_buffer,
+                                                             reinterpret_cast<void*> (data_size));
+            if (error == CL_SUCCESS)
+                OCLMetrics::instance ( ).allocate (data_size);
+            else
+                OCLMetrics::instance ( ).error (error);
+
+            return buffer;
+        }
+
         /**
          * Compiles the kernel code passed as a constructor parameter.
          */
@@ -223,10 +298,9 @@ class OCLKernel
                     }
                     if (this->program_ptr)
                         delete this->program_ptr;
+                    this->program_ptr = 0;
 
-                    cl::Program::Sources clsource (1, this->get_source_size_pair ( ));
-                    this->program_ptr = new cl::Program (this->context, clsource);
-                    this->program_ptr->build (this->devices, options);
+                    this->program_ptr = new cl::Program (this->compile (options));
                     this->program = *(this->program_ptr);
 
                     // release compiler resources
@@ -234,6 +308,7 @@ class OCLKernel
                 }
                 catch (cl::Error &error)
                 {
+                    OCLMetrics::instance ( ).error (error.err ( ));
                     std::cerr << "::: ERROR: kernel compilation failed!" << std::endl;
                     std::cerr << "::: ERROR: " << error.what ( )
                               << "(" << error.err ( ) << ")" << std::endl;
@@ -245,6 +320,26 @@ class OCLKernel
             }
         }
 
+        /**
+         * Compiles the kernel code passed as a constructor parameter into
+         * a new program, leaving the one built by 'build(...)' untouched.
+         * It may be called from another thread, e.g. by OCLProgramCache.
+         * Throws cl::Error if compilation fails.
+         */
+        cl::Program compile (const char * options=NULL)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ( );
+
+            cl::Program::Sources clsource (1, this->get_source_size_pair ( ));
+            cl::Program program (this->context, clsource);
+            program.build (this->devices, options);
+
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now ( ) - start;
+            OCLMetrics::instance ( ).build (elapsed.count ( ));
+
+            return program;
+        }
+
 
         /**
          * Activates one kernel function from the compiled binary kernels
@@ -252,6 +347,61 @@ class OCLKernel
          * The activated kernel is implicitly used in later function calls.
          */
         void activate_kernel (const char *kernel_name)
+        {
+            this->activate_kernel (kernel_name, this->program);
+        }
+
+        /**
+         * Activates a kernel object created beforehand by
+         * 'create_kernel(...)', so that switching among several kernels
+         * does not create a new object every time.
+         */
+        void activate_kernel (const char *kernel_name,
+                              const cl::Kernel &kernel)
+        {
+            if (this->kernel_ptr)
+                delete this->kernel_ptr;
+
+            this->kernel_ptr = new cl::Kernel (kernel);
+            this->kernel = *(this->kernel_ptr);
+            this->launch_counter = OCLMetrics::instance ( ).launch_counter (kernel_name);
+        }
+
+        /**
+         * Creates a kernel object for the function 'kernel_name'
+         * of the program compiled by 'build(...)'.
+         * Throws cl::Error if there is no such function.
+         */
+        cl::Kernel create_kernel (const char *kernel_name)
+        {
+            return this->create_kernel (kernel_name, this->program);
+        }
+
+        /**
+         * Creates a kernel object for the function 'kernel_name'
+         * of the given 'program', e.g. one compiled by 'compile(...)'.
+         * Throws cl::Error if there is no such function.
+         */
+        cl::Kernel create_kernel (const char *kernel_name,
+                                  const cl::Program &program)
+        {
+            try
+            {
+                return cl::Kernel (program, kernel_name);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
+        }
+
+        /**
+         * Activates one kernel function from the given 'program', e.g.
+         * one compiled by 'compile(...)' with different options.
+         */
+        void activate_kernel (const char *kernel_name,
+                              const cl::Program &program)
         {
             cl_int error;
 
@@ -264,18 +414,29 @@ class OCLKernel
             }
             if (this->kernel_ptr)
                 delete this->kernel_ptr;
+            this->kernel_ptr = 0;
 
-            this->kernel_ptr = new cl::Kernel (this->program, kernel_name, &error);
+            try
+            {
+                this->kernel_ptr = new cl::Kernel (program, kernel_name, &error);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
 
             if (error == CL_SUCCESS)
             {
                 this->kernel = *(this->kernel_ptr);
+                this->launch_counter = OCLMetrics::instance ( ).launch_counter (kernel_name);
                 if (this->verbose)
                     std::cout << "done!" << std::endl;
             }
             else
             {
                 this->kernel_ptr = 0;
+                OCLMetrics::instance ( ).error (error);
                 std::cerr << "::: ERROR kernel activation failed ("
                           << error << ")"
                           << std::endl;
@@ -285,13 +446,15 @@ class OCLKernel
         
         /**
          * Sets a N-dimensional execution range to the activated kernel.
+         * Returns false, keeping the previous range, if it is invalid.
          */
-        void set_range (const int dimension,
+        bool set_range (const int dimension,
                         const size_t global_sizes [], 
                         const size_t local_sizes [],
                         const size_t offsets [] = NULL)
         {
             const size_t zero_offsets [] = {0, 0, 0};
+            cl::NDRange global_range, local_range, offset_range;
 
             if (this->kernel_ptr)
             {
@@ -303,36 +466,36 @@ class OCLKernel
                 switch (dimension)
                 {
                     case (1):
-                        this->global = cl::NDRange (global_sizes[0]);
-                        this->local = cl::NDRange (local_sizes[0]);
-                        this->offset = cl::NDRange (offsets[0]);
+                        global_range = cl::NDRange (global_sizes[0]);
+                        local_range = cl::NDRange (local_sizes[0]);
+                        offset_range = cl::NDRange (offsets[0]);
                         break;
 
                     case (2):
-                        this->global = cl::NDRange (global_sizes[0], global_sizes[1]);
-                        this->local = cl::NDRange (local_sizes[0], local_sizes[1]);
-                        this->offset = cl::NDRange (offsets[0], offsets[1]);
+                        global_range = cl::NDRange (global_sizes[0], global_sizes[1]);
+                        local_range = cl::NDRange (local_sizes[0], local_sizes[1]);
+                        offset_range = cl::NDRange (offsets[0], offsets[1]);
                         break;
 
                     case (3):
-                        this->global = cl::NDRange (global_sizes[0], global_sizes[1], global_sizes[2]);
-                        this->local = cl::NDRange (local_sizes[0], local_sizes[1], local_sizes[2]);
-                        this->offset = cl::NDRange (offsets[0], offsets[1], offsets[2]);
+                        global_range = cl::NDRange (global_sizes[0], global_sizes[1], global_sizes[2]);
+                        local_range = cl::NDRange (local_sizes[0], local_sizes[1], local_sizes[2]);
+                        offset_range = cl::NDRange (offsets[0], offsets[1], offsets[2]);
                         break;
                 }
                 // check that the execution range is valid
                 unsigned int i, wgroup_size = 1, total_threads = 1;
 
-                if ((this->global.dimensions ( ) > 0) &&
-                    (this->global.dimensions ( ) == this->local.dimensions ( )) &&
-                    (this->local.dimensions ( ) == this->offset.dimensions ( )))
+                if ((global_range.dimensions ( ) > 0) &&
+                    (global_range.dimensions ( ) == local_range.dimensions ( )) &&
+                    (local_range.dimensions ( ) == offset_range.dimensions ( )))
                 {
-                    for (i = 0; i < this->global.dimensions ( ); i ++)
+                    for (i = 0; i < global_range.dimensions ( ); i ++)
                     {
                         if ((global_sizes[i] % local_sizes[i]) != 0)
                         {
                             std::cerr << "::: ERROR local size must divide global size" << std::endl;
-                            return;
+                            return false;
                         }
                         // calculate the total number of threads per block
                         wgroup_size *= local_sizes[i];
@@ -343,20 +506,25 @@ class OCLKernel
                     {
                         std::cerr << "::: ERROR local work group size exceeds hardware limit ";
                         std::cerr << "(" << this->max_wgroup_size << ")" << std::endl;
-                        return;
+                        return false;
                     }
                     if (total_threads < wgroup_size)
                     {
                         std::cerr << "::: ERROR global size should be greater ";
                         std::cerr << "or equal than local size" << std::endl;
-                        return;
+                        return false;
                     }
                 }
                 else
                 {
                      std::cerr << "::: ERROR kernel range is invalid" << std::endl;
-                     return;
+                     return false;
                 }
+                // the range is only replaced once it is known to be valid
+                this->global = global_range;
+                this->local = local_range;
+                this->offset = offset_range;
+
                 if (this->verbose)
                 {
                     std::cout << ":: " 
@@ -380,10 +548,12 @@ class OCLKernel
                     }
                     std::cout << std::endl;
                 }
+                return true;
             }
             else
             {
                 std::cerr << "::: ERROR activate a kernel before calling 'set_range(...)'" << std::endl;
+                return false;
             }
         }
 
@@ -391,11 +561,11 @@ class OCLKernel
         /**
          * Sets a 1-dimensional execution range to the activated kernel.
          */
-        void set_1D_range (const size_t global_sizes [], 
+        bool set_1D_range (const size_t global_sizes [], 
                            const size_t local_sizes [],
                            const size_t offsets [] = NULL)
         {
-            this->set_range (1, 
+            return this->set_range (1, 
                              global_sizes, 
                              local_sizes, 
                              offsets);
@@ -404,11 +574,11 @@ class OCLKernel
         /**
          * Sets a 2-dimensional execution range to the activated kernel.
          */
-        void set_2D_range (const size_t global_sizes [], 
+        bool set_2D_range (const size_t global_sizes [], 
                            const size_t local_sizes [],
                            const size_t offsets [] = NULL)
         {
-            this->set_range (2,
+            return this->set_range (2,
                              global_sizes, 
                              local_sizes, 
                              offsets);
@@ -417,11 +587,11 @@ class OCLKernel
         /**
          * Sets a 3-dimensional execution range to the activated kernel.
          */
-        void set_3D_range (const size_t global_sizes [], 
+        bool set_3D_range (const size_t global_sizes [], 
                            const size_t local_sizes [],
                            const size_t offsets [] = NULL)
         {
-            this->set_range (3,
+            return this->set_range (3,
                              global_sizes, 
                              local_sizes, 
                              offsets);
@@ -484,10 +654,20 @@ class OCLKernel
                           << " with size " << sizeof(T)
                           << std::endl;
             }
-            cl_int error = this->kernel.setArg (index, value);
+            cl_int error;
+            try
+            {
+                error = this->kernel.setArg (index, value);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
 
             if (error != CL_SUCCESS)
             {
+                OCLMetrics::instance ( ).error (error);
                 std::cerr << "::: ERROR setting " << index 
                           << " kernel value parameter!" << std::endl;
             }
@@ -498,9 +678,25 @@ class OCLKernel
          * Runs the activated kernel.
          * It waits for it to finish execution 
          * based on the value of 'wait'.
+         * Returns false if the kernel could not be run.
+         */
+        bool run (bool wait=false)
+        {
+            return this->run_on (this->queue, wait);
+        }
+
+        /**
+         * Runs the activated kernel on the given 'queue', which should
+         * belong to the context of this object, e.g. one of an OCLQueueSet.
+         * Execution starts after all the 'events' have completed, and
+         * 'event' (if given) tracks the execution of this kernel.
+         * Returns false if the kernel could not be run.
          */
-         void run (bool wait=false)
-         {
+        bool run_on (const cl::CommandQueue &queue,
+                     bool wait=false,
+                     const std::vector<cl::Event> *events=NULL,
+                     cl::Event *event=NULL)
+        {
             if (this->kernel_ptr)
             {
                 if ((this->global.dimensions ( ) > 0) &&
@@ -513,30 +709,37 @@ class OCLKernel
                             std::cout << ":: Kernel execution started ... ";
                         
                         // run the kernel with the given execution range
-                        cl_int error = this->queue.enqueueNDRangeKernel (this->kernel,
-                                                                         this->offset,
-                                                                         this->global,
-                                                                         this->local);
+                        cl_int error = queue.enqueueNDRangeKernel (this->kernel,
+                                                                   this->offset,
+                                                                   this->global,
+                                                                   this->local,
+                                                                   events,
+                                                                   event);
                         if (error == CL_SUCCESS)
                         {
+                            this->launch_counter->fetch_add (1, std::memory_order_relaxed);
+
                             // wait for the kernel to finish?
                             if (wait)
                             {
-                                this->queue.finish ( );
+                                queue.finish ( );
                                 if (this->verbose)
                                     std::cout << "done!";
                             }
                             if (this->verbose)
                                 std::cout << std::endl;
+                            return true;
                         }
                         else
                         {
+                            OCLMetrics::instance ( ).error (error);
                             std::cerr << "::: ERROR kernel execution failed"
                                       << " (" << error << ")" << std::endl;
                         }
                     }
                     catch (cl::Error &error)
                     {
+                        OCLMetrics::instance ( ).error (error.err ( ));
                         std::cerr << "::: ERROR kernel execution failed!" << std::endl;
                         std::cerr << "::: ERROR " << error.what ( )
                                   << "(" << error.err ( ) << ")" << std::endl;
@@ -553,14 +756,16 @@ class OCLKernel
                 std::cerr << "::: ERROR: a kernel has to be activated "
                           << "before calling 'run_and_wait(...)'" << std::endl;
             }
+            return false;
         }
 
         /**
          * Runs the activated kernel and waits for it to finish execution.
+         * Returns false if the kernel could not be run.
          */
-        void run_and_wait ( )
+        bool run_and_wait ( )
         {
-            this->run (true);
+            return this->run (true);
         }
         
         const cl::Context& get_context ( )
@@ -573,6 +778,16 @@ class OCLKernel
             return this->devices[0];
         }
 
+        size_t get_max_wgroup_size ( )
+        {
+            return this->max_wgroup_size;
+        }
+
+        cl_ulong get_local_mem_size ( )
+        {
+            return this->local_mem_size;
+        }
+
         const char* get_source ( )
         {
             return this->m_source;
@@ -594,6 +809,7 @@ class OCLKernel
             cl::Program program;
             cl::Kernel *kernel_ptr;
             cl::Kernel kernel;
+            std::atomic<cl_ulong> *launch_counter;
             cl::KernelFunctor functor;
             size_t m_size;
             char *m_source;
@@ -601,6 +817,7 @@ class OCLKernel
             bool functor_active;
             size_t max_wgroup_size;
             cl_ulong local_mem_size;
+            cl_ulong global_mem_size;
             cl::NDRange global;
             cl::NDRange local;
             cl::NDRange offset;
@@ -610,6 +827,15 @@ class OCLKernel
             {
                 return std::make_pair (m_source, m_size);
             }
+
+            /**
+             * Called by the OpenCL runtime when a buffer
+             * allocated by 'create_buffer(...)' is released.
+             */
+            static void CL_CALLBACK release_buffer (cl_mem memobj, void *user_data)
+            {
+                OCLMetrics::instance ( ).release (reinterpret_cast<size_t> (user_data));
+            }
 };
 
 #endif
@@ -0,0 +1,255 @@
+#ifndef _OCLMETRICS_HPP_
+#define _OCLMETRICS_HPP_
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <CL/cl.hpp>
+
+
+
+/**
+ * Process-wide counters and gauges about the OpenCL runtime:
+ * kernel launches, bytes transferred, device memory in use,
+ * kernel builds and errors by code.
+ * Counters are updated with relaxed atomic operations only, so
+ * keeping track of them costs next to nothing in the hot path.-
+ */
+class OCLMetrics
+{
+    public:
+        /**
+         * Standard error codes are counted in slots indexed by '-code';
+         * any other code, e.g. from an extension, is counted in a map.
+         */
+        static const int ERROR_SLOTS = 128;
+
+        /**
+         * Returns the single instance of this class.
+         */
+        static OCLMetrics& instance ( )
+        {
+            static OCLMetrics metrics;
+            return metrics;
+        }
+
+        /**
+         * Destructor.
+         * Launch counters are deliberately never freed, since kernel
+         * objects may still use them during static destruction.
+         */
+        virtual ~OCLMetrics ( )
+        {
+        }
+
+        /**
+         * Returns the launch counter of the kernel called 'kernel_name',
+         * creating it if needed. Callers should keep the returned
+         * pointer, which remains valid for the life of the process.
+         */
+        std::atomic<cl_ulong>* launch_counter (const char *kernel_name)
+        {
+            std::lock_guard<std::mutex> lock (this->mutex);
+            std::atomic<cl_ulong> *&counter = this->launches[kernel_name];
+            if (counter == 0)
+                counter = new std::atomic<cl_ulong> (0);
+            return counter;
+        }
+
+        void host_to_device (const size_t bytes)
+        {
+            this->bytes_h2d.fetch_add (bytes, std::memory_order_relaxed);
+        }
+
+        void device_to_host (const size_t bytes)
+        {
+            this->bytes_d2h.fetch_add (bytes, std::memory_order_relaxed);
+        }
+
+        /**
+         * Accounts for 'bytes' of newly allocated device memory,
+         * keeping track of the peak.
+         */
+        void allocate (const size_t bytes)
+        {
+            cl_ulong now = this->allocated.fetch_add (bytes, std::memory_order_relaxed) + bytes;
+            cl_ulong peak = this->allocated_peak.load (std::memory_order_relaxed);
+            while ((now > peak) &&
+                   !this->allocated_peak.compare_exchange_weak (peak, now, std::memory_order_relaxed))
+                ;
+        }
+
+        void release (const size_t bytes)
+        {
+            this->allocated.fetch_sub (bytes, std::memory_order_relaxed);
+        }
+
+        void set_global_mem_size (const cl_ulong bytes)
+        {
+            this->global_mem_size.store (bytes, std::memory_order_relaxed);
+        }
+
+        /**
+         * Accounts for one kernel build taking 'nanoseconds'.
+         */
+        void build (const cl_ulong nanoseconds)
+        {
+            this->builds.fetch_add (1, std::memory_order_relaxed);
+            this->build_ns.fetch_add (nanoseconds, std::memory_order_relaxed);
+        }
+
+        void error (const cl_int code)
+        {
+            int slot = -code;
+            if ((slot >= 0) && (slot < ERROR_SLOTS))
+            {
+                this->errors[slot].fetch_add (1, std::memory_order_relaxed);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock (this->mutex);
+                this->other_errors[code] ++;
+            }
+        }
+
+        cl_ulong get_allocated ( )
+        {
+            return this->allocated.load (std::memory_order_relaxed);
+        }
+
+        cl_ulong get_allocated_peak ( )
+        {
+            return this->allocated_peak.load (std::memory_order_relaxed);
+        }
+
+        /**
+         * Returns a snapshot of all metrics
+         * in the Prometheus text exposition format.
+         */
+        std::string to_prometheus ( )
+        {
+            std::ostringstream out;
+            std::map<std::string, std::atomic<cl_ulong>*>::iterator it;
+            std::map<cl_int, cl_ulong> errors;
+            std::map<cl_int, cl_ulong>::iterator ite;
+
+            out << "# TYPE ocl_kernel_launches_total counter\n";
+            {
+                std::lock_guard<std::mutex> lock (this->mutex);
+                for (it = this->launches.begin ( ); it != this->launches.end ( ); it ++)
+                    out << "ocl_kernel_launches_total{kernel=\"" << it->first << "\"} "
+                        << it->second->load (std::memory_order_relaxed) << "\n";
+            }
+            out << "# TYPE ocl_host_to_device_bytes_total counter\n"
+                << "ocl_host_to_device_bytes_total " << this->bytes_h2d.load ( ) << "\n"
+                << "# TYPE ocl_device_to_host_bytes_total counter\n"
+                << "ocl_device_to_host_bytes_total " << this->bytes_d2h.load ( ) << "\n"
+                << "# TYPE ocl_device_allocated_bytes gauge\n"
+                << "ocl_device_allocated_bytes " << this->allocated.load ( ) << "\n"
+                << "# TYPE ocl_device_allocated_peak_bytes gauge\n"
+                << "ocl_device_allocated_peak_bytes " << this->allocated_peak.load ( ) << "\n"
+                << "# TYPE ocl_device_global_mem_bytes gauge\n"
+                << "ocl_device_global_mem_bytes " << this->global_mem_size.load ( ) << "\n"
+                << "# TYPE ocl_builds_total counter\n"
+                << "ocl_builds_total " << this->builds.load ( ) << "\n"
+                << "# TYPE ocl_build_seconds_total counter\n"
+                << "ocl_build_seconds_total " << this->build_ns.load ( ) * 1e-9 << "\n"
+                << "# TYPE ocl_errors_total counter\n";
+            errors = this->error_counts ( );
+            for (ite = errors.begin ( ); ite != errors.end ( ); ite ++)
+                out << "ocl_errors_total{code=\"" << ite->first << "\"} "
+                    << ite->second << "\n";
+            return out.str ( );
+        }
+
+        /**
+         * Returns a snapshot of all metrics as a JSON object.
+         */
+        std::string to_json ( )
+        {
+            const char *sep;
+            std::ostringstream out;
+            std::map<std::string, std::atomic<cl_ulong>*>::iterator it;
+            std::map<cl_int, cl_ulong> errors;
+            std::map<cl_int, cl_ulong>::iterator ite;
+
+            out << "{\"kernel_launches\": {";
+            {
+                std::lock_guard<std::mutex> lock (this->mutex);
+                sep = "";
+                for (it = this->launches.begin ( ); it != this->launches.end ( ); it ++)
+                {
+                    out << sep << "\"" << it->first << "\": "
+                        << it->second->load (std::memory_order_relaxed);
+                    sep = ", ";
+                }
+            }
+            out << "}, \"host_to_device_bytes\": " << this->bytes_h2d.load ( )
+                << ", \"device_to_host_bytes\": " << this->bytes_d2h.load ( )
+                << ", \"device_allocated_bytes\": " << this->allocated.load ( )
+                << ", \"device_allocated_peak_bytes\": " << this->allocated_peak.load ( )
+                << ", \"device_global_mem_bytes\": " << this->global_mem_size.load ( )
+                << ", \"builds\": " << this->builds.load ( )
+                << ", \"build_seconds\": " << this->build_ns.load ( ) * 1e-9
+                << ", \"errors\": {";
+            sep = "";
+            errors = this->error_counts ( );
+            for (ite = errors.begin ( ); ite != errors.end ( ); ite ++)
+            {
+                out << sep << "\"" << ite->first << "\": " << ite->second;
+                sep = ", ";
+            }
+            out << "}}";
+            return out.str ( );
+        }
+
+
+        private:
+            std::mutex mutex;
+            std::map<std::string, std::atomic<cl_ulong>*> launches;
+            std::atomic<cl_ulong> bytes_h2d;
+            std::atomic<cl_ulong> bytes_d2h;
+            std::atomic<cl_ulong> allocated;
+            std::atomic<cl_ulong> allocated_peak;
+            std::atomic<cl_ulong> global_mem_size;
+            std::atomic<cl_ulong> builds;
+            std::atomic<cl_ulong> build_ns;
+            std::atomic<cl_ulong> errors [ERROR_SLOTS];
+            std::map<cl_int, cl_ulong> other_errors;
+
+            OCLMetrics ( ) : bytes_h2d(0), bytes_d2h(0),
+                             allocated(0), allocated_peak(0),
+                             global_mem_size(0),
+                             builds(0), build_ns(0)
+            {
+                int i;
+                for (i = 0; i < ERROR_SLOTS; i ++)
+                    this->errors[i].store (0);
+            }
+
+            OCLMetrics (const OCLMetrics&);
+            OCLMetrics& operator= (const OCLMetrics&);
+
+            /**
+             * Returns the number of errors seen so far, by code.
+             */
+            std::map<cl_int, cl_ulong> error_counts ( )
+            {
+                int i;
+                std::map<cl_int, cl_ulong> counts;
+
+                for (i = 0; i < ERROR_SLOTS; i ++)
+                {
+                    cl_ulong count = this->errors[i].load (std::memory_order_relaxed);
+                    if (count > 0)
+                        counts[-i] = count;
+                }
+                std::lock_guard<std::mutex> lock (this->mutex);
+                counts.insert (this->other_errors.begin ( ), this->other_errors.end ( ));
+                return counts;
+            }
+};
+
+#endif
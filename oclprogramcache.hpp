@@ -0,0 +1,280 @@
+#ifndef _OCLPROGRAMCACHE_HPP_
+#define _OCLPROGRAMCACHE_HPP_
+
+#include <map>
+#include <list>
+#include <string>
+#include <future>
+
+#include "oclkernel.hpp"
+
+
+
+/**
+ * A cache of programs compiled from the source of an OCLKernel,
+ * each one specialised on a set of compile-time constants given as
+ * '-D' defines, e.g. matrix width or loop trip count, so that the
+ * device compiler may unroll loops and fold strides.
+ * Specialisations are compiled in the background, one at a time;
+ * until one is ready, the generic program is used instead, and asking
+ * for another one meanwhile does not start its compilation, which is
+ * left to a later request. At most 'capacity' of them are kept,
+ * dropping the least recently used first.
+ * The cache is not thread-safe.-
+ */
+class OCLProgramCache
+{
+    public:
+        /**
+         * Compile-time constants, by name.
+         */
+        typedef std::map<std::string, std::string> Defines;
+
+        /**
+         * Constructor.
+         * The generic program is compiled right away, using
+         * 'options', which are also passed to every specialisation.
+         * Throws cl::Error if the generic program does not compile.
+         */
+        OCLProgramCache (OCLKernel &kernel,
+                         const char *options="",
+                         const unsigned int capacity=8) : kernel(kernel),
+                                                          options(options),
+                                                          capacity(capacity)
+        {
+            this->generic = kernel.compile (options);
+        }
+
+        /**
+         * Destructor.
+         * Waits for any specialisation still being compiled.
+         */
+        virtual ~OCLProgramCache ( )
+        {
+            std::list<Entry>::iterator it;
+            for (it = this->entries.begin ( ); it != this->entries.end ( ); it ++)
+            {
+                if (it->pending.valid ( ))
+                    it->pending.wait ( );
+            }
+        }
+
+        /**
+         * Returns the program specialised on 'defines' if it has already
+         * been compiled; otherwise, its compilation is started unless
+         * another one is in progress, and the generic program is
+         * returned. If given, 'specialised' tells which one of them
+         * was returned.
+         */
+        cl::Program get (const Defines &defines,
+                         bool *specialised=NULL)
+        {
+            Entry *entry = this->lookup (defines);
+
+            if (specialised)
+                *specialised = (entry != NULL);
+            if (entry)
+                return entry->program;
+            else
+                return this->generic;
+        }
+
+        /**
+         * Activates 'kernel_name' from the program specialised on
+         * 'defines' or, while it is not ready, from the generic one.
+         * Returns true if the specialised program was used.
+         * One kernel object is kept per program and function, so its
+         * arguments are kept between calls; they have to be set again
+         * whenever the returned value changes, i.e. once the specialised
+         * program replaces the generic one.
+         */
+        bool activate_kernel (const char *kernel_name,
+                              const Defines &defines)
+        {
+            Entry *entry = this->lookup (defines);
+            const cl::Program *program = &this->generic;
+            std::map<std::string, cl::Kernel> *kernels = &this->generic_kernels;
+            std::map<std::string, cl::Kernel>::iterator it;
+
+            if (entry)
+            {
+                program = &entry->program;
+                kernels = &entry->kernels;
+            }
+            it = kernels->find (kernel_name);
+            if (it == kernels->end ( ))
+            {
+                cl::Kernel created = this->kernel.create_kernel (kernel_name, *program);
+                it = kernels->insert (std::make_pair (std::string (kernel_name),
+                                                      created)).first;
+            }
+            this->kernel.activate_kernel (kernel_name, it->second);
+
+            return (entry != NULL);
+        }
+
+        const cl::Program& get_generic ( )
+        {
+            return this->generic;
+        }
+
+        unsigned int get_size ( )
+        {
+            return this->entries.size ( );
+        }
+
+
+        private:
+            enum State
+            {
+                COMPILING,
+                READY,
+                FAILED
+            };
+
+            struct Entry
+            {
+                std::string key;
+                State state;
+                cl::Program program;
+                std::future<cl::Program> pending;
+                std::map<std::string, cl::Kernel> kernels;
+            };
+
+            OCLKernel &kernel;
+            std::string options;
+            unsigned int capacity;
+            cl::Program generic;
+            std::map<std::string, cl::Kernel> generic_kernels;
+            std::list<Entry> entries;
+            std::map<std::string, std::list<Entry>::iterator> index;
+
+            OCLProgramCache (const OCLProgramCache&);
+            OCLProgramCache& operator= (const OCLProgramCache&);
+
+            /**
+             * Returns the entry specialised on 'defines' if its program
+             * is ready, or NULL otherwise. A missing entry is added and
+             * its compilation started, as long as no other one is in
+             * progress, so that the cache never grows beyond 'capacity'.
+             */
+            Entry* lookup (const Defines &defines)
+            {
+                std::string key = this->build_options (defines);
+                std::map<std::string, std::list<Entry>::iterator>::iterator found;
+                OCLKernel *kernel = &this->kernel;
+
+                found = this->index.find (key);
+                if (found == this->index.end ( ))
+                {
+                    if (this->compiling ( ))
+                        return NULL;
+                    this->evict ( );
+                    if (this->entries.size ( ) >= this->capacity)
+                        return NULL;
+
+                    this->entries.push_front (Entry ( ));
+                    Entry &entry = this->entries.front ( );
+                    entry.key = key;
+                    entry.state = COMPILING;
+                    // the background build keeps its own copy of the options
+                    entry.pending = std::async (std::launch::async,
+                                                [kernel, key] ( )
+                                                {
+                                                    return kernel->compile (key.c_str ( ));
+                                                });
+                    this->index[key] = this->entries.begin ( );
+                    return NULL;
+                }
+
+                // most recently used first
+                this->entries.splice (this->entries.begin ( ),
+                                      this->entries,
+                                      found->second);
+                Entry &entry = this->entries.front ( );
+                this->update (entry);
+
+                if (entry.state == READY)
+                    return &entry;
+                else
+                    return NULL;
+            }
+
+            /**
+             * Builds the compiler options for 'defines', listing them
+             * in the same order for the same set.
+             */
+            std::string build_options (const Defines &defines)
+            {
+                std::string result (this->options);
+                Defines::const_iterator it;
+
+                for (it = defines.begin ( ); it != defines.end ( ); it ++)
+                {
+                    result += " -D" + it->first;
+                    if (!it->second.empty ( ))
+                        result += "=" + it->second;
+                }
+                return result;
+            }
+
+            /**
+             * Picks up the program of 'entry' if its compilation finished.
+             */
+            void update (Entry &entry)
+            {
+                if (entry.state != COMPILING)
+                    return;
+                if (entry.pending.wait_for (std::chrono::seconds (0)) != std::future_status::ready)
+                    return;
+                try
+                {
+                    entry.program = entry.pending.get ( );
+                    entry.state = READY;
+                }
+                catch (cl::Error &error)
+                {
+                    // keep the entry, so it is not compiled over and over
+                    entry.state = FAILED;
+                    OCLMetrics::instance ( ).error (error.err ( ));
+                    std::cerr << "::: ERROR: kernel specialisation failed!" << std::endl;
+                    std::cerr << "\t|| Options ||\t" << entry.key << std::endl;
+                    std::cerr << "::: ERROR: " << error.what ( )
+                              << "(" << error.err ( ) << ")" << std::endl;
+                }
+            }
+
+            /**
+             * Tells whether a specialisation is still being compiled.
+             */
+            bool compiling ( )
+            {
+                bool result = false;
+                std::list<Entry>::iterator it;
+
+                for (it = this->entries.begin ( ); it != this->entries.end ( ); it ++)
+                {
+                    this->update (*it);
+                    if (it->state == COMPILING)
+                        result = true;
+                }
+                return result;
+            }
+
+            /**
+             * Makes room for one more specialisation, dropping the least
+             * recently used ones. It is called when none is compiling,
+             * so any of them may be dropped.
+             */
+            void evict ( )
+            {
+                while ((!this->entries.empty ( )) &&
+                       (this->entries.size ( ) >= this->capacity))
+                {
+                    this->index.erase (this->entries.back ( ).key);
+                    this->entries.pop_back ( );
+                }
+            }
+};
+
+#endif
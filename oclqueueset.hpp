@@ -0,0 +1,368 @@
+#ifndef _OCLQUEUESET_HPP_
+#define _OCLQUEUESET_HPP_
+
+#include <vector>
+
+#include "oclkernel.hpp"
+
+
+
+/**
+ * A set of command queues on the device of an OCLKernel, so that
+ * independent kernels and transfers may overlap on the device.
+ * Kernels go to the compute queues and transfers to the copy queues;
+ * each command is assigned to one queue of its kind, either by turns
+ * or to the one with the fewest commands still in flight.
+ * Commands may land on different queues, so any ordering between them
+ * has to be expressed with events, e.g. through an OCLStream; each
+ * queue is flushed after every command, so that commands waiting on
+ * it from another queue do not wait forever.
+ * The set is not thread-safe.-
+ */
+class OCLQueueSet
+{
+    public:
+        /**
+         * Ways of assigning a command to one of the queues.
+         */
+        enum Policy
+        {
+            ROUND_ROBIN,
+            LEAST_LOADED
+        };
+
+        /**
+         * Constructor.
+         * The queues are created on the context and device of 'kernel',
+         * which should be initialized. Queues are created in out-of-order
+         * mode only if 'out_of_order' is set and the device supports it.
+         */
+        OCLQueueSet (OCLKernel &kernel,
+                     const unsigned int compute_queues=2,
+                     const unsigned int copy_queues=1,
+                     const bool out_of_order=true,
+                     const Policy policy=ROUND_ROBIN) : policy(policy),
+                                                        next_compute(0),
+                                                        next_copy(0)
+        {
+            unsigned int i;
+            cl_command_queue_properties supported = 0;
+            cl_command_queue_properties properties = 0;
+
+            kernel.get_device ( ).getInfo (CL_DEVICE_QUEUE_PROPERTIES, &supported);
+            if (out_of_order && (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+                properties = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+            this->out_of_order = (properties != 0);
+
+            // at least one queue of each kind
+            for (i = 0; (i == 0) || (i < compute_queues); i ++)
+                this->compute.push_back (cl::CommandQueue (kernel.get_context ( ),
+                                                           kernel.get_device ( ),
+                                                           properties));
+            for (i = 0; (i == 0) || (i < copy_queues); i ++)
+                this->copy.push_back (cl::CommandQueue (kernel.get_context ( ),
+                                                        kernel.get_device ( ),
+                                                        properties));
+            this->compute_inflight.resize (this->compute.size ( ));
+            this->copy_inflight.resize (this->copy.size ( ));
+        }
+
+        /**
+         * Runs the activated kernel of 'kernel' on one of the compute
+         * queues, after all the 'events' have completed.
+         * Returns the event tracking its execution.
+         */
+        cl::Event run (OCLKernel &kernel,
+                       const std::vector<cl::Event> &events=std::vector<cl::Event> ( ))
+        {
+            cl::Event event;
+            unsigned int q = this->pick (this->compute_inflight, this->next_compute);
+
+            kernel.run_on (this->compute[q], false, this->wait_list (events), &event);
+            if (event ( ) != NULL)
+            {
+                // commands on other queues may wait for this one
+                this->compute[q].flush ( );
+                this->compute_inflight[q].push_back (event);
+            }
+
+            return event;
+        }
+
+        /**
+         * Transfers 'data_size' bytes from 'host_data' to 'device_data'
+         * on one of the copy queues, after all the 'events' have completed.
+         * The host memory should not be touched until the returned
+         * event has completed.
+         */
+        cl::Event write_buffer (const cl::Buffer &device_data,
+                                const void *host_data,
+                                const size_t data_size,
+                                const std::vector<cl::Event> &events=std::vector<cl::Event> ( ))
+        {
+            cl::Event event;
+            unsigned int q = this->pick (this->copy_inflight, this->next_copy);
+
+            cl_int error;
+            try
+            {
+                error = this->copy[q].enqueueWriteBuffer (device_data,
+                                                          CL_FALSE,
+                                                          0,
+                                                          data_size,
+                                                          host_data,
+                                                          this->wait_list (events),
+                                                          &event);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
+            if (error == CL_SUCCESS)
+            {
+                OCLMetrics::instance ( ).host_to_device (data_size);
+                this->copy[q].flush ( );
+                this->copy_inflight[q].push_back (event);
+            }
+            else
+            {
+                OCLMetrics::instance ( ).error (error);
+                std::cerr << "::: ERROR writing data to device" << std::endl;
+            }
+            return event;
+        }
+
+        /**
+         * Transfers 'data_size' bytes from 'device_data' to 'host_data'
+         * on one of the copy queues, after all the 'events' have completed.
+         * The host memory is valid once the returned event has completed.
+         */
+        cl::Event read_buffer (const cl::Buffer &device_data,
+                               void *host_data,
+                               const size_t data_size,
+                               const std::vector<cl::Event> &events=std::vector<cl::Event> ( ))
+        {
+            cl::Event event;
+            unsigned int q = this->pick (this->copy_inflight, this->next_copy);
+
+            cl_int error;
+            try
+            {
+                error = this->copy[q].enqueueReadBuffer (device_data,
+                                                         CL_FALSE,
+                                                         0,
+                                                         data_size,
+                                                         host_data,
+                                                         this->wait_list (events),
+                                                         &event);
+            }
+            catch (cl::Error &error)
+            {
+                OCLMetrics::instance ( ).error (error.err ( ));
+                throw;
+            }
+            if (error == CL_SUCCESS)
+            {
+                OCLMetrics::instance ( ).device_to_host (data_size);
+                this->copy[q].flush ( );
+                this->copy_inflight[q].push_back (event);
+            }
+            else
+            {
+                OCLMetrics::instance ( ).error (error);
+                std::cerr << "::: ERROR reading data from device" << std::endl;
+            }
+            return event;
+        }
+
+        /**
+         * Waits for every command in every queue to finish.
+         */
+        void finish ( )
+        {
+            unsigned int i;
+            for (i = 0; i < this->compute.size ( ); i ++)
+            {
+                this->compute[i].finish ( );
+                this->compute_inflight[i].clear ( );
+            }
+            for (i = 0; i < this->copy.size ( ); i ++)
+            {
+                this->copy[i].finish ( );
+                this->copy_inflight[i].clear ( );
+            }
+        }
+
+        bool is_out_of_order ( )
+        {
+            return this->out_of_order;
+        }
+
+        unsigned int get_compute_queues ( )
+        {
+            return this->compute.size ( );
+        }
+
+        unsigned int get_copy_queues ( )
+        {
+            return this->copy.size ( );
+        }
+
+
+        private:
+            Policy policy;
+            bool out_of_order;
+            unsigned int next_compute;
+            unsigned int next_copy;
+            std::vector<cl::CommandQueue> compute;
+            std::vector<cl::CommandQueue> copy;
+            std::vector<std::vector<cl::Event> > compute_inflight;
+            std::vector<std::vector<cl::Event> > copy_inflight;
+
+            /**
+             * Some revisions of the C++ bindings do not accept
+             * an empty wait list, but only a missing one.
+             */
+            const std::vector<cl::Event>* wait_list (const std::vector<cl::Event> &events)
+            {
+                if (events.empty ( ))
+                    return NULL;
+                else
+                    return &events;
+            }
+
+            /**
+             * Forgets about the commands of 'inflight' that have completed.
+             */
+            void prune (std::vector<cl::Event> &inflight)
+            {
+                unsigned int i, kept = 0;
+                for (i = 0; i < inflight.size ( ); i ++)
+                {
+                    cl_int status = CL_COMPLETE;
+                    inflight[i].getInfo (CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+                    if (status > CL_COMPLETE)
+                        inflight[kept ++] = inflight[i];
+                }
+                inflight.resize (kept);
+            }
+
+            /**
+             * Returns the index of the queue that gets the next command,
+             * according to the assignment policy.
+             */
+            unsigned int pick (std::vector<std::vector<cl::Event> > &inflight,
+                               unsigned int &next)
+            {
+                unsigned int i, q = 0;
+
+                for (i = 0; i < inflight.size ( ); i ++)
+                    this->prune (inflight[i]);
+
+                if (this->policy == LEAST_LOADED)
+                {
+                    for (i = 1; i < inflight.size ( ); i ++)
+                    {
+                        if (inflight[i].size ( ) < inflight[q].size ( ))
+                            q = i;
+                    }
+                }
+                else
+                {
+                    q = next;
+                    next = (next + 1) % inflight.size ( );
+                }
+                return q;
+            }
+};
+
+
+
+/**
+ * A sequence of commands running in order on an OCLQueueSet.
+ * Each command waits for the previous one, whatever queue it ran on,
+ * while commands from different streams may run concurrently.-
+ */
+class OCLStream
+{
+    public:
+        /**
+         * Constructor
+         */
+        OCLStream (OCLQueueSet &queues) : queues(queues)
+        {
+        }
+
+        /**
+         * Runs the activated kernel of 'kernel' after the previous
+         * command of this stream and any other 'events'.
+         * Returns a null event if the command could not be enqueued;
+         * later commands still wait for the previous one.
+         */
+        cl::Event run (OCLKernel &kernel,
+                       const std::vector<cl::Event> &events=std::vector<cl::Event> ( ))
+        {
+            return this->follow (this->queues.run (kernel, this->after (events)));
+        }
+
+        cl::Event write_buffer (const cl::Buffer &device_data,
+                                const void *host_data,
+                                const size_t data_size,
+                                const std::vector<cl::Event> &events=std::vector<cl::Event> ( ))
+        {
+            return this->follow (this->queues.write_buffer (device_data,
+                                                            host_data,
+                                                            data_size,
+                                                            this->after (events)));
+        }
+
+        cl::Event read_buffer (const cl::Buffer &device_data,
+                               void *host_data,
+                               const size_t data_size,
+                               const std::vector<cl::Event> &events=std::vector<cl::Event> ( ))
+        {
+            return this->follow (this->queues.read_buffer (device_data,
+                                                           host_data,
+                                                           data_size,
+                                                           this->after (events)));
+        }
+
+        /**
+         * Waits for the last command of this stream to finish.
+         */
+        void wait ( )
+        {
+            if (this->last ( ) != NULL)
+                this->last.wait ( );
+        }
+
+
+        private:
+            OCLQueueSet &queues;
+            cl::Event last;
+
+            /**
+             * The 'events' plus the last command of this stream.
+             */
+            std::vector<cl::Event> after (const std::vector<cl::Event> &events)
+            {
+                std::vector<cl::Event> dependencies (events);
+                if (this->last ( ) != NULL)
+                    dependencies.push_back (this->last);
+                return dependencies;
+            }
+
+            /**
+             * Makes 'event' the last command of this stream,
+             * unless it failed to be enqueued.
+             */
+            cl::Event follow (const cl::Event &event)
+            {
+                if (event ( ) != NULL)
+                    this->last = event;
+                return event;
+            }
+};
+
+#endif
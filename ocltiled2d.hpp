@@ -0,0 +1,266 @@
+#ifndef _OCLTILED2D_HPP_
+#define _OCLTILED2D_HPP_
+
+#include <vector>
+#include <sstream>
+
+#include "oclkernel.hpp"
+
+
+
+/**
+ * Tiled, local-memory 2D kernels (transpose, GEMM and stencil)
+ * found in 'tiled2d.cl'. The tile size is derived from the hardware
+ * limits of the device and passed to the compiler as a constant.
+ * The given kernel object should be created with 'tiled2d.cl'
+ * as its source file, and it should be initialized.
+ * Each operation may be set up once with its 'prepare_*(...)' method
+ * and launched many times with 'run( )'.-
+ */
+class OCLTiled2D
+{
+    public:
+        /**
+         * Constructor
+         */
+        OCLTiled2D (OCLKernel &kernel,
+                    const unsigned int stencil_radius=1) : kernel(kernel),
+                                                           tile_dim(0),
+                                                           tile_pad(1),
+                                                           stencil_radius(stencil_radius)
+        {
+        }
+
+        /**
+         * Picks the largest tile side, a power of two, such that one
+         * tile of threads fits in a work group and the local memory
+         * needed by every kernel fits in the device.
+         * Compiles the kernels afterwards, trying smaller tiles if they
+         * do not compile or do not accept that many threads per group.
+         * Throws cl::Error if no tile size works.
+         */
+        void build ( )
+        {
+            size_t dim, next;
+            size_t max_wgroup_size = this->kernel.get_max_wgroup_size ( );
+            cl_ulong local_mem_size = this->kernel.get_local_mem_size ( );
+            std::vector<size_t> max_item_sizes;
+
+            this->kernel.get_device ( ).getInfo (CL_DEVICE_MAX_WORK_ITEM_SIZES,
+                                                 &max_item_sizes);
+            dim = 1;
+            next = 2;
+            while ((next * next <= max_wgroup_size) &&
+                   (next <= max_item_sizes[0]) &&
+                   (next <= max_item_sizes[1]) &&
+                   (this->local_bytes (next) < local_mem_size))
+            {
+                dim = next;
+                next *= 2;
+            }
+
+            for (this->tile_dim = dim; this->tile_dim > 0; this->tile_dim /= 2)
+            {
+                std::ostringstream options;
+                options << "-I."
+                        << " -D_TILE_DIM_=" << this->tile_dim
+                        << " -D_TILE_PAD_=" << this->tile_pad
+                        << " -D_STENCIL_RADIUS_=" << this->stencil_radius;
+                try
+                {
+                    // the kernels always come from this very tile size
+                    cl::Program program = this->kernel.compile (options.str ( ).c_str ( ));
+                    this->transpose_kernel = cl::Kernel (program, "transpose");
+                    this->gemm_kernel = cl::Kernel (program, "gemm");
+                    this->stencil_kernel = cl::Kernel (program, "stencil");
+                }
+                catch (cl::Error &error)
+                {
+                    OCLMetrics::instance ( ).error (error.err ( ));
+                    std::cerr << "::: WARNING tiled kernels do not compile with tiles of "
+                              << this->tile_dim << " x " << this->tile_dim
+                              << " (" << error.err ( ) << ")" << std::endl;
+                    continue;
+                }
+                if (this->fits (this->transpose_kernel) &&
+                    this->fits (this->gemm_kernel) &&
+                    this->fits (this->stencil_kernel))
+                    return;
+            }
+            throw cl::Error (CL_INVALID_WORK_GROUP_SIZE,
+                             "OCLTiled2D: no tile size fits the tiled kernels");
+        }
+
+        /**
+         * Sets up the transposition of the 'width' x 'height' matrix
+         * in 'input' into 'output'.
+         */
+        void prepare_transpose (const cl::Buffer &input,
+                                const cl::Buffer &output,
+                                const cl_int width,
+                                const cl_int height)
+        {
+            this->kernel.activate_kernel ("transpose", this->transpose_kernel);
+            this->set_range (width, height);
+            this->kernel.set_arg (0, input);
+            this->kernel.set_arg (1, output);
+            this->kernel.set_arg (2, width);
+            this->kernel.set_arg (3, height);
+        }
+
+        /**
+         * Sets up C = A * B, where 'a' is 'm' x 'k' and 'b' is 'k' x 'n'.
+         */
+        void prepare_gemm (const cl::Buffer &a,
+                           const cl::Buffer &b,
+                           const cl::Buffer &c,
+                           const cl_int m,
+                           const cl_int n,
+                           const cl_int k)
+        {
+            this->kernel.activate_kernel ("gemm", this->gemm_kernel);
+            this->set_range (n, m);
+            this->kernel.set_arg (0, a);
+            this->kernel.set_arg (1, b);
+            this->kernel.set_arg (2, c);
+            this->kernel.set_arg (3, m);
+            this->kernel.set_arg (4, n);
+            this->kernel.set_arg (5, k);
+        }
+
+        /**
+         * Sets up the stencil 'weights', a square of 2*radius+1
+         * elements per side, applied to the 'width' x 'height' matrix
+         * in 'input', saving the result in 'output'.
+         */
+        void prepare_stencil (const cl::Buffer &input,
+                              const cl::Buffer &weights,
+                              const cl::Buffer &output,
+                              const cl_int width,
+                              const cl_int height)
+        {
+            this->kernel.activate_kernel ("stencil", this->stencil_kernel);
+            this->set_range (width, height);
+            this->kernel.set_arg (0, input);
+            this->kernel.set_arg (1, weights);
+            this->kernel.set_arg (2, output);
+            this->kernel.set_arg (3, width);
+            this->kernel.set_arg (4, height);
+        }
+
+        /**
+         * Runs the last operation set up, waiting for it to finish.
+         */
+        void run ( )
+        {
+            this->kernel.run_and_wait ( );
+        }
+
+        /**
+         * Transposes the 'width' x 'height' matrix in 'input'
+         * into 'output'.
+         */
+        void transpose (const cl::Buffer &input,
+                        const cl::Buffer &output,
+                        const cl_int width,
+                        const cl_int height)
+        {
+            this->prepare_transpose (input, output, width, height);
+            this->run ( );
+        }
+
+        /**
+         * Computes C = A * B, where 'a' is 'm' x 'k'
+         * and 'b' is 'k' x 'n'.
+         */
+        void gemm (const cl::Buffer &a,
+                   const cl::Buffer &b,
+                   const cl::Buffer &c,
+                   const cl_int m,
+                   const cl_int n,
+                   const cl_int k)
+        {
+            this->prepare_gemm (a, b, c, m, n, k);
+            this->run ( );
+        }
+
+        /**
+         * Applies the stencil 'weights', a square of 2*radius+1
+         * elements per side, to the 'width' x 'height' matrix in
+         * 'input', saving the result in 'output'.
+         */
+        void stencil (const cl::Buffer &input,
+                      const cl::Buffer &weights,
+                      const cl::Buffer &output,
+                      const cl_int width,
+                      const cl_int height)
+        {
+            this->prepare_stencil (input, weights, output, width, height);
+            this->run ( );
+        }
+
+        size_t get_tile_dim ( )
+        {
+            return this->tile_dim;
+        }
+
+        unsigned int get_stencil_radius ( )
+        {
+            return this->stencil_radius;
+        }
+
+
+        private:
+            OCLKernel &kernel;
+            size_t tile_dim;
+            size_t tile_pad;
+            unsigned int stencil_radius;
+            cl::Kernel transpose_kernel;
+            cl::Kernel gemm_kernel;
+            cl::Kernel stencil_kernel;
+
+            /**
+             * Local memory needed by the most demanding kernel
+             * when using tiles of 'dim' x 'dim' elements.
+             */
+            size_t local_bytes (const size_t dim)
+            {
+                size_t gemm_bytes = 2 * dim * (dim + this->tile_pad);
+                size_t halo = dim + 2 * this->stencil_radius;
+                size_t stencil_bytes = halo * (halo + this->tile_pad);
+
+                if (stencil_bytes > gemm_bytes)
+                    return stencil_bytes * sizeof(real);
+                else
+                    return gemm_bytes * sizeof(real);
+            }
+
+            /**
+             * Checks that the compiled 'kernel' accepts
+             * one tile of threads per work group.
+             */
+            bool fits (const cl::Kernel &kernel)
+            {
+                size_t wgroup_size = 0;
+                kernel.getWorkGroupInfo (this->kernel.get_device ( ),
+                                         CL_KERNEL_WORK_GROUP_SIZE,
+                                         &wgroup_size);
+                return (this->tile_dim * this->tile_dim <= wgroup_size);
+            }
+
+            /**
+             * Covers a 'width' x 'height' matrix with whole tiles.
+             */
+            void set_range (const size_t width,
+                            const size_t height)
+            {
+                size_t global_sizes [] = {width, height};
+                size_t local_sizes [] = {this->tile_dim, this->tile_dim};
+
+                global_sizes[0] = ((width + this->tile_dim - 1) / this->tile_dim) * this->tile_dim;
+                global_sizes[1] = ((height + this->tile_dim - 1) / this->tile_dim) * this->tile_dim;
+                this->kernel.set_2D_range (global_sizes, local_sizes);
+            }
+};
+
+#endif
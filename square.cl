@@ -21,3 +21,25 @@ __kernel void square (__global real *input,
     int elem = gid_x + gid_y*size_x;
     output[elem] = input[elem] * input[elem];
 }
+
+__kernel void batched_square (__global real *input,
+                              __global real *output)
+{
+    int gid_x = get_global_id(0);
+    int gid_y = get_global_id(1);
+    int size_x = get_global_size (0);
+    int size_y = get_global_size (1);
+    int batch = get_global_id(2);
+    int elem = gid_x + gid_y*size_x + batch*size_x*size_y;
+    output[elem] = input[elem] * input[elem];
+}
+
+__kernel void scaled_square (__global real *input,
+                             __global real *output)
+{
+    int gid_x = get_global_id(0);
+    int gid_y = get_global_id(1);
+    int size_x = get_global_size (0);
+    int elem = gid_x + gid_y*size_x;
+    output[elem] = _MY_CONSTANT_ * input[elem] * input[elem];
+}
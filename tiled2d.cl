@@ -0,0 +1,144 @@
+#ifdef cl_khr_fp64
+	#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+#ifdef cl_amd_fp64
+	#pragma OPENCL EXTENSION cl_amd_fp64 : enable
+#endif
+typedef double	real;
+typedef double2	real2;
+typedef double4 real4;
+
+/**
+ * Tile sizes are given at build time, e.g. by OCLTiled2D.
+ * The extra column of padding keeps the threads of a wavefront
+ * reading a tile column from hitting the same local memory bank.
+ */
+#ifndef _TILE_DIM_
+    #define _TILE_DIM_ 16
+#endif
+#ifndef _TILE_PAD_
+    #define _TILE_PAD_ 1
+#endif
+#ifndef _STENCIL_RADIUS_
+    #define _STENCIL_RADIUS_ 1
+#endif
+
+#define _STENCIL_WIDTH_ (2*_STENCIL_RADIUS_ + 1)
+#define _HALO_DIM_ (_TILE_DIM_ + 2*_STENCIL_RADIUS_)
+
+
+
+/**
+ * Transposes a 'width' x 'height' matrix into 'output'.
+ */
+__kernel void transpose (__global const real *input,
+                         __global real *output,
+                         const int width,
+                         const int height)
+{
+    __local real tile[_TILE_DIM_][_TILE_DIM_ + _TILE_PAD_];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int gx = get_group_id(0)*_TILE_DIM_ + lx;
+    int gy = get_group_id(1)*_TILE_DIM_ + ly;
+
+    // coalesced read of one block
+    if ((gx < width) && (gy < height))
+        tile[ly][lx] = input[gx + gy*width];
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    // coalesced write of the mirrored block
+    gx = get_group_id(1)*_TILE_DIM_ + lx;
+    gy = get_group_id(0)*_TILE_DIM_ + ly;
+    if ((gx < height) && (gy < width))
+        output[gx + gy*height] = tile[lx][ly];
+}
+
+
+
+/**
+ * Computes C = A * B, where A is 'm' x 'k' and B is 'k' x 'n'.
+ * All matrices are stored by rows.
+ */
+__kernel void gemm (__global const real *a,
+                    __global const real *b,
+                    __global real *c,
+                    const int m,
+                    const int n,
+                    const int k)
+{
+    __local real a_tile[_TILE_DIM_][_TILE_DIM_ + _TILE_PAD_];
+    __local real b_tile[_TILE_DIM_][_TILE_DIM_ + _TILE_PAD_];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int col = get_group_id(0)*_TILE_DIM_ + lx;
+    int row = get_group_id(1)*_TILE_DIM_ + ly;
+    int t, i;
+    real acc = 0;
+
+    for (t = 0; t < k; t += _TILE_DIM_)
+    {
+        // load one tile of each matrix, padding with zeros at the borders
+        a_tile[ly][lx] = ((row < m) && (t + lx < k)) ? a[(t + lx) + row*k] : 0;
+        b_tile[ly][lx] = ((t + ly < k) && (col < n)) ? b[col + (t + ly)*n] : 0;
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+
+        // constant trip count, so the compiler may unroll it
+        for (i = 0; i < _TILE_DIM_; i ++)
+            acc += a_tile[ly][i] * b_tile[i][lx];
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+    }
+    if ((row < m) && (col < n))
+        c[col + row*n] = acc;
+}
+
+
+
+/**
+ * Applies a square stencil of '_STENCIL_WIDTH_' x '_STENCIL_WIDTH_'
+ * 'weights', stored by rows, to a 'width' x 'height' matrix.
+ * Elements outside the matrix take the value of the nearest border.
+ */
+__kernel void stencil (__global const real *input,
+                       __constant real *weights,
+                       __global real *output,
+                       const int width,
+                       const int height)
+{
+    __local real tile[_HALO_DIM_][_HALO_DIM_ + _TILE_PAD_];
+
+    int lx = get_local_id(0);
+    int ly = get_local_id(1);
+    int bx = get_group_id(0)*_TILE_DIM_ - _STENCIL_RADIUS_;
+    int by = get_group_id(1)*_TILE_DIM_ - _STENCIL_RADIUS_;
+    int x, y, ix, iy;
+
+    // load the block together with its halo
+    for (y = ly; y < _HALO_DIM_; y += _TILE_DIM_)
+    {
+        for (x = lx; x < _HALO_DIM_; x += _TILE_DIM_)
+        {
+            ix = clamp (bx + x, 0, width - 1);
+            iy = clamp (by + y, 0, height - 1);
+            tile[y][x] = input[ix + iy*width];
+        }
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    int gx = get_group_id(0)*_TILE_DIM_ + lx;
+    int gy = get_group_id(1)*_TILE_DIM_ + ly;
+    if ((gx < width) && (gy < height))
+    {
+        real acc = 0;
+        for (y = 0; y < _STENCIL_WIDTH_; y ++)
+            for (x = 0; x < _STENCIL_WIDTH_; x ++)
+                acc += weights[x + y*_STENCIL_WIDTH_] * tile[ly + y][lx + x];
+        output[gx + gy*width] = acc;
+    }
+}